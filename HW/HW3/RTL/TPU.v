@@ -9,6 +9,10 @@ module TPU(
     N,
     busy,
 
+    stream,
+    blk_valid,
+    blk_done,
+
     A_wr_en,
     A_index,
     A_data_in,
@@ -29,11 +33,19 @@ module TPU(
 input clk;
 input rst_n;
 input            in_valid;
-input [7:0]      K;
-input [7:0]      M;
-input [7:0]      N;
+input [15:0]     K;
+input [15:0]     M;
+input [15:0]     N;
 output  reg      busy;
 
+//* Streaming mode, sampled with in_valid. A and B arrive one block pair
+//* (4 rows of A, 4 columns of B) at a time in two slots, slot s at index s*K,
+//* the first pair in slot 0 before in_valid. Pairs come in the usual order
+//* (A blocks inner) and the C tile of each goes to C[s*4 .. s*4+3].
+input            stream;
+input            blk_valid;  //* next block pair is in its slot
+output           blk_done;   //* one cycle: tile written, its slot can be refilled
+
 output           A_wr_en;
 output [15:0]    A_index;  //* select this
 output [31:0]    A_data_in;
@@ -57,11 +69,14 @@ assign A_wr_en = 0;
 assign B_wr_en = 0;
 assign C_wr_en = 1;
 
-reg [7:0] k;
-reg [7:0] m;
-reg [7:0] n;
+reg [15:0] k;
+reg [15:0] m;
+reg [15:0] n;
+reg st;
 
-output [7:0] cur_block_B;
+wire [15:0] cur_block_B;
+wire hold;
+wire slot;
 output [31:0] delayed_A_data_out;
 output [31:0] delayed_B_data_out;
 
@@ -74,12 +89,17 @@ controller controller(
     .reset (rst_n),
     .block_over (block_over),
     .finish (finish),
+    .in_valid (in_valid),
     .K   (k),
     .M   (m),
     .N   (n),
+    .stream (st),
+    .blk_valid (blk_valid),
     .cur_block_B (cur_block_B),
     .A_index (A_index),
     .B_index (B_index),
+    .hold (hold),
+    .slot (slot),
     .busy (busy_c)
 );
 
@@ -108,17 +128,22 @@ sysArr sysArr(
     .finish (finish),
     .K (k),
     .M (m),
+    .stream (st),
+    .hold (hold),
+    .slot (slot),
     .cur_block_B (cur_block_B),
     .datain_h (delayed_A_data_out),
     .datain_v (delayed_B_data_out),
     .C_index (C_index),
     .C_data_in (C_data_in),
+    .blk_done (blk_done),
     .busy (busy_c)
 );
 
 
 initial begin
     busy = 0;
+    st = 0;
 end
 
 always @(negedge clk) begin
@@ -130,6 +155,7 @@ always @(negedge clk) begin
         k = K;
         m = M;
         n = N;
+        st = (stream === 1'b1);
     end
 end
 
@@ -142,34 +168,63 @@ module controller(
     busy,
     block_over,
     finish,
+    in_valid,
     K,
     M,
     N,
+    stream,
+    blk_valid,
 
     cur_block_B,
     A_index,
     B_index,
+    hold,
+    slot,
 );
+    parameter PARK = 16'hFFFF;  // index past any data, the buffers read 0 there
+
     input clk;
     input reset;
     input busy;
     input block_over;
     output reg finish;
-    input [7:0] K;
-    input [7:0] M;
-    input [7:0] N;
+    input in_valid;
+    input [15:0] K;
+    input [15:0] M;
+    input [15:0] N;
+    input stream;
+    input blk_valid;
 
     output [15:0] A_index;
     output [15:0] B_index;
-    reg signed [15:0] count_A;
-    reg signed [15:0] count_B;
-    reg [7:0] num_block_A;
-    reg [7:0] cur_block_A;
-    reg [7:0] num_block_B;
-    output reg [7:0] cur_block_B;
+    reg signed [31:0] count_A;
+    reg signed [31:0] count_B;
+    reg [15:0] num_block_A;
+    reg [15:0] cur_block_A;
+    reg [15:0] num_block_B;
+    output reg [15:0] cur_block_B;
+
+    output reg hold;  // stream: waiting for the next block pair
+    output reg slot;  // stream: slot of the block pair being computed
+    integer blk_pending;  // stream: block pairs announced, not started yet
+    reg blk_seen;  // blk_valid at the last posedge
+    reg new_case;  // in_valid at the last posedge
     
-    assign A_index = count_A;
-    assign B_index = count_B;
+    assign A_index = count_A[15:0];
+    assign B_index = count_B[15:0];
+
+    always @(negedge reset) begin
+        blk_pending = 0;
+        blk_seen = 0;
+        new_case = 0;
+        hold = 0;
+    end
+
+    //* Sampled here, counted in the negedge block, the only one writing blk_pending
+    always @(posedge clk) begin
+        blk_seen <= (blk_valid === 1'b1);
+        new_case <= (in_valid === 1'b1);
+    end
 
     always @(negedge reset or negedge busy) begin
         if(finish >= 0) begin
@@ -180,6 +235,8 @@ module controller(
         end
         #1
         finish = 0;
+        hold = 0;
+        slot = 0;
 
         count_A = -1;
         count_B = -1;
@@ -191,19 +248,27 @@ module controller(
         cur_block_B = 0;
     end
 
+    //* Block pair bases: block * K, or slot * K when streaming
     always @(posedge block_over) begin
-        if(cur_block_A < num_block_A - 1) begin
-            cur_block_A += 1;
-
-            count_B = cur_block_B*K-1;
-            count_A = cur_block_A*K-1;
-        end
-        else if (cur_block_B < num_block_B - 1) begin
-            cur_block_A = 0;
-            cur_block_B += 1;
+        if(cur_block_A < num_block_A - 1 || cur_block_B < num_block_B - 1) begin
+            if(cur_block_A < num_block_A - 1) begin
+                cur_block_A += 1;
+            end
+            else begin
+                cur_block_A = 0;
+                cur_block_B += 1;
+            end
 
-            count_B = cur_block_B*K-1;
-            count_A = cur_block_A*K-1;
+            if(!stream) begin
+                count_B = cur_block_B*K-1;
+                count_A = cur_block_A*K-1;
+            end
+            else begin  // feed zeros, the negedge block starts the pair once announced
+                slot = ~slot;
+                hold = 1;
+                count_B = PARK;
+                count_A = PARK;
+            end
         end
         else begin
             finish = 1;
@@ -211,16 +276,34 @@ module controller(
     end
 
     always @(negedge clk) begin
-        if(busy && !block_over) begin
-            if(count_A == (cur_block_A+1)*K-1 || count_A == 16320) begin
-                count_A = 16320;
+        //* blk_pending: a new case clears it, then the last posedge's blk_valid
+        //* adds one, then a held pair takes one
+        if(new_case) begin
+            blk_pending = 0;
+        end
+        if(blk_seen) begin
+            blk_pending = blk_pending + 1;
+        end
+
+        if(busy && !block_over && hold) begin
+            if(blk_pending > 0) begin
+                //* right after block_over: same timing as a non-streaming pair
+                blk_pending = blk_pending - 1;
+                hold = 0;
+                count_B = slot*K;
+                count_A = slot*K;
+            end
+        end
+        else if(busy && !block_over) begin
+            if(count_A == ((stream ? slot : cur_block_A)+1)*K-1 || count_A == PARK) begin
+                count_A = PARK;
             end
             else begin
                 count_A = count_A + 1;
             end
 
-            if(count_B == (cur_block_B+1)*K-1 || count_B == 16320) begin
-                count_B = 16320;
+            if(count_B == ((stream ? slot : cur_block_B)+1)*K-1 || count_B == PARK) begin
+                count_B = PARK;
             end
             else begin
                 count_B = count_B + 1;
@@ -414,19 +497,26 @@ module sysArr(
     finish,
     K,
     M,
+    stream,
+    hold,
+    slot,
     cur_block_B,
     datain_h,
     datain_v,
     C_index,
-    C_data_in
+    C_data_in,
+    blk_done
 );
     parameter wh = 4;
     input clk;
     input reset;
     input finish;
-    input [7:0] K;
-    input [7:0] M;
-    input [7:0] cur_block_B;
+    input [15:0] K;
+    input [15:0] M;
+    input stream;
+    input hold;
+    input slot;
+    input [15:0] cur_block_B;
     input [8*wh-1:0] datain_h;
     input [8*wh-1:0] datain_v;
 
@@ -440,11 +530,12 @@ module sysArr(
     output [15:0] C_index;
     output reg [127:0] C_data_in;
     output [511:0] C_data_in_c;
+    output reg blk_done;
 
-    reg signed [15:0] count;
-    reg signed [15:0] accumu_index;
-    reg [7:0] row;
-    assign C_index = accumu_index;
+    reg signed [31:0] count;
+    reg signed [31:0] accumu_index;
+    reg [15:0] stream_index;  // C row inside the tile's slot when streaming
+    assign C_index = stream ? stream_index : accumu_index[15:0];
 
     genvar i, j;
     generate
@@ -613,17 +704,21 @@ module sysArr(
             repeat(3) @(negedge clk);
         end
         accumu_index = -1;
+        stream_index = 16'hFFFF;
+        blk_done = 0;
         busy = 1;  // Here I do set busy to high immediately after in_valid fall from high to low
         block_over = 0;
     end
     
     always @(posedge clk) begin
-        if(busy) begin
+        blk_done = 0;
+        if(busy && !hold) begin
             count = count + 1;
         end
         if(count == K+12) begin
             count = 0;
             macc_wr = 0;
+            blk_done = stream;
             block_over = 1;
             #1
             block_over = 0;
@@ -634,6 +729,7 @@ module sysArr(
         if(count >= K+8) begin
             if(accumu_index < 0 || accumu_index < M * (cur_block_B+1) - 1) begin
                 accumu_index += 1;
+                stream_index = {slot, 2'b00} + (accumu_index%M)%4;
                 if((accumu_index%M)%4 == 0) begin
                     macc_wr = macc_wr + 4'b1111;
                     #1
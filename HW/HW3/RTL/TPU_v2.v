@@ -28,9 +28,11 @@ module TPU(
 input clk;
 input rst_n;
 input            in_valid;
-input [7:0]      K;
-input [7:0]      M;
-input [7:0]      N;
+//* 16-bit ports to share the testbench with TPU.v, but K, M and N have to
+//* stay within 1..255 here (PATTERN.v checks it under TPU_V2)
+input [15:0]     K;
+input [15:0]     M;
+input [15:0]     N;
 output  reg      busy;
 
 output           A_wr_en;
@@ -78,9 +80,9 @@ always @(posedge clk or negedge rst_n) begin
         N_in <= 'd0;
     end
     else if (in_valid) begin
-        K_in <= K;
-        M_in <= M;
-        N_in <= N; 
+        K_in <= K[7:0];
+        M_in <= M[7:0];
+        N_in <= N[7:0]; 
     end
 end
 
@@ -123,7 +125,6 @@ always @(posedge clk or negedge rst_n) begin
         A_index <= 'd0;
 end
 
-reg [7:0] change_line;
 always @(posedge clk or negedge rst_n) begin
     if (!rst_n)
         B_index <= 'd0;
@@ -4,6 +4,18 @@
 
 `include "RTL/global_buffer.v"
 
+`ifdef TPU_V2
+`define TPU_DESIGN "TPU_v2"
+`else
+`define TPU_DESIGN "TPU"
+`endif
+
+//* STREAM: cycles the host waits after each tile before refilling its slot,
+//* longer than K+12 makes the TPU stall for the next block pair
+`ifndef STREAM_GAP
+`define STREAM_GAP 0
+`endif
+
 
 module PATTERN(
     clk,
@@ -15,6 +27,10 @@ module PATTERN(
     N,
     busy,
 
+    stream,
+    blk_valid,
+    blk_done,
+
     A_wr_en,
     A_index,
     A_data_in,
@@ -36,11 +52,15 @@ output reg          clk;
 output reg          rst_n;
 
 output reg          in_valid;
-output reg [7:0]    K;
-output reg [7:0]    M;
-output reg [7:0]    N;
+output reg [15:0]   K;
+output reg [15:0]   M;
+output reg [15:0]   N;
 input               busy;
 
+output reg          stream;
+output reg          blk_valid;
+input               blk_done;
+
 
 input               A_wr_en;
 input      [15:0]   A_index;
@@ -70,6 +90,14 @@ integer patcount;
 integer nrow;
 integer i, j, k;
 integer err;
+integer bench_fd;
+integer ideal_cycles;
+integer base_A, base_B, base_C;
+integer nblk_A, nblk_B, nblk, blk;
+integer a_blk, b_blk;
+integer tiles_done;
+integer stall;
+reg [63:0] cycle_limit;
 
 
 real CYCLE;
@@ -80,11 +108,11 @@ real CYCLE;
 
 reg [127:0] GOLDEN [65535:0];
 
-reg [7:0] rbuf [3:0];
-reg [31:0] goldenbuf [3:0];
-reg [7:0] K_golden;
-reg [7:0] M_golden;
-reg [7:0] N_golden;
+reg [31:0] word;
+reg [15:0] K_golden;
+reg [15:0] M_golden;
+reg [15:0] N_golden;
+reg [127:0] tile_golden;
 
 
 
@@ -143,6 +171,8 @@ initial begin
     K = 'bx;
     M = 'bx;
     N = 'bx;
+    stream = 1'b0;
+    blk_valid = 1'b0;
     cycles = 0;
     total_cycles = 0;
 
@@ -152,15 +182,24 @@ initial begin
     reset_task;
 
 
-    in_fd = $fopen("./TESTBENCH/input.txt", "r");
+    in_fd = $fopen("./TESTBENCH/input.bin", "rb");
 
     //* PATNUM
-    scanRet = $fscanf(in_fd, "%d", PATNUM);
+    scanRet = $fread(word, in_fd);
+    PATNUM = word;
+
+    `ifdef BENCH
+    bench_fd = $fopen("bench.csv", "a");
+    `endif
 
     for(patcount = 0; patcount < PATNUM; patcount = patcount + 1) begin
 
         //* read input
         read_KMN;
+        `ifdef STREAM
+        stream_case;
+        `else
+        check_fits;
         read_A_Matrix;
         read_B_Matrix;
         read_golden;
@@ -182,13 +221,20 @@ initial begin
         wait_finished;
         
         golden_check;
+        `endif
 
         $display("\033[0;34mPASS PATTERN NO.%4d,\033[m \033[0;32m Cycles: %3d\033[m", patcount ,cycles);
+        `ifdef BENCH
+        bench_report;
+        `endif
         total_cycles = total_cycles + cycles;
         cycles = 0;
         repeat(5) @(negedge clk);
     end
 
+    `ifdef BENCH
+    $fclose(bench_fd);
+    `endif
     YOU_PASS_task;
     $finish;
 
@@ -215,10 +261,39 @@ end endtask
 
 
 
+//* input.bin is big endian: K M N as 32-bit words, then A and B one 32-bit
+//* word per buffer entry and the golden C one 128-bit word per entry
 task read_KMN; begin
-    scanRet = $fscanf(in_fd, "%h", K_golden);
-    scanRet = $fscanf(in_fd, "%h", M_golden);
-    scanRet = $fscanf(in_fd, "%h", N_golden);
+    scanRet = $fread(word, in_fd);
+    K_golden = word;
+    scanRet = $fread(word, in_fd);
+    M_golden = word;
+    scanRet = $fread(word, in_fd);
+    N_golden = word;
+
+    `ifdef TPU_V2
+    if(K_golden > 255 || M_golden > 255 || N_golden > 255) begin
+        $display("K = %0d, M = %0d, N = %0d: TPU_v2 only handles K, M, N up to 255", K_golden, M_golden, N_golden);
+        $finish;
+    end
+    `endif
+
+    //* give up at twice TPU.v's K + 12 cycles per block pair, 1500000 at least
+    cycle_limit = 2 * ((M_golden + 3) >> 2) * ((N_golden + 3) >> 2) * (K_golden + 12);
+    if(cycle_limit < 1500000) begin
+        cycle_limit = 1500000;
+    end
+end endtask
+
+
+//* A, B and C have to fit the 16-bit buffer index, the last entry is
+//* left free (the TPU parks its read index there)
+task check_fits; begin
+    if(K_golden * ((M_golden + 3) >> 2) > 65535 || K_golden * ((N_golden + 3) >> 2) > 65535 ||
+       M_golden * ((N_golden + 3) >> 2) > 65535) begin
+        $display("K = %0d, M = %0d, N = %0d does not fit the buffers, run it with STREAM", K_golden, M_golden, N_golden);
+        $finish;
+    end
 end endtask
 
 
@@ -226,11 +301,7 @@ task read_A_Matrix; begin
 
     nrow = (M_golden[1:0] !== 2'b00) ?  K_golden * ((M_golden>>2) + 1) : K_golden * (M_golden>>2);
     
-    for(i=0;i<nrow;i=i+1) begin
-        scanRet = $fscanf(in_fd, "%h %h %h %h", rbuf[3], rbuf[2], rbuf[1], rbuf[0]);
-        gbuff_A.gbuff[i] = {rbuf[3], rbuf[2], rbuf[1], rbuf[0]};
-        // $display("A[%d] = %8h", i, gbuff_A.gbuff[i]);
-    end
+    scanRet = $fread(gbuff_A.gbuff, in_fd, 0, nrow);
 
 end endtask
 
@@ -239,11 +310,7 @@ task read_B_Matrix; begin
 
     nrow = (N_golden[1:0] !== 2'b00) ? K_golden * ((N_golden >> 2) + 1) : K_golden * (N_golden >> 2);
 
-    for(i=0;i<nrow;i=i+1) begin
-        scanRet = $fscanf(in_fd, "%h %h %h %h", rbuf[3], rbuf[2], rbuf[1], rbuf[0]);
-        gbuff_B.gbuff[i] = {rbuf[3], rbuf[2], rbuf[1], rbuf[0]};
-        // $display("B[%d] = %8h", i, gbuff_A.gbuff[i]);
-    end
+    scanRet = $fread(gbuff_B.gbuff, in_fd, 0, nrow);
 
 end endtask
 
@@ -252,13 +319,141 @@ task read_golden; begin
 
     nrow = (N_golden[1:0] !== 2'b00) ? M_golden * ((N_golden>>2) + 1) : M_golden * (N_golden>>2);
 
-    for(i=0;i<nrow;i=i+1) begin
-        scanRet = $fscanf(in_fd, "%h %h %h %h", goldenbuf[3], goldenbuf[2], goldenbuf[1], goldenbuf[0]);
-        GOLDEN[i] = {goldenbuf[3], goldenbuf[2], goldenbuf[1], goldenbuf[0]};
-        // $display("GOLDEN[%d] = %8h %8h %8h %8h", i, GOLDEN[i][127:96],  GOLDEN[i][95:64],  GOLDEN[i][63:32],  GOLDEN[i][31:0]);
+    scanRet = $fread(GOLDEN, in_fd, 0, nrow);
+
+end endtask
+
+
+//* bench.csv: design,K,M,N,cycles,ideal_cycles,pe_utilization
+//* ideal = one K step per cycle on every 4x4 tile of C, utilization = useful
+//* MACs / (16 PEs * cycles)
+task bench_report; begin
+    ideal_cycles = ((M_golden + 3) >> 2) * ((N_golden + 3) >> 2) * K_golden;
+    $fdisplay(bench_fd, "%s,%0d,%0d,%0d,%0d,%0d,%.4f", `TPU_DESIGN, K_golden, M_golden, N_golden,
+              cycles, ideal_cycles, (1.0 * K_golden * M_golden * N_golden) / (16.0 * cycles));
+end endtask
+
+
+//* STREAM: only block pair slots 0/1 of A and B (at 0 and K) and tile
+//* slots 0/1 of C (at 0 and 4) are used. Pairs are read from input.bin into
+//* their slot one ahead of the TPU, each tile is checked as soon as blk_done
+//* says it is written and its slot is refilled with the pair after next.
+`ifdef STREAM
+always @(negedge clk) begin
+    if(blk_done === 1'b1) begin
+        tiles_done = tiles_done + 1;
+    end
+end
+
+task stream_case; begin
+    if(2 * K_golden > 65535) begin
+        $display("K = %0d, streaming needs K <= 32767", K_golden);
+        $finish;
+    end
+
+    nblk_A = (M_golden + 3) >> 2;
+    nblk_B = (N_golden + 3) >> 2;
+    nblk = nblk_A * nblk_B;
+    base_A = $ftell(in_fd);
+    base_B = base_A + 4 * K_golden * nblk_A;
+    base_C = base_B + 4 * K_golden * nblk_B;
+
+    err = 0;
+    tiles_done = 0;
+    load_block(0);
+    repeat(3) @(negedge clk);
+
+    in_valid = 1'b1;
+    stream = 1'b1;
+    K = K_golden;
+    M = M_golden;
+    N = N_golden;
+    @(negedge clk);
+
+    in_valid = 1'b0;
+    stream = 1'b0;
+    K = 'bx;
+    M = 'bx;
+    N = 'bx;
+
+    cycles = 0;
+    if(nblk > 1) begin
+        load_block(1);
+        pulse_blk_valid;
+    end
+
+    for(blk = 0; blk < nblk; blk = blk + 1) begin
+        stall = 0;
+        while(tiles_done <= blk) begin
+            stream_tick;
+        end
+        tile_check;
+        if(blk + 2 < nblk) begin
+            repeat(`STREAM_GAP) stream_tick;
+            load_block(blk + 2);
+            pulse_blk_valid;
+        end
+    end
+
+    while(busy === 1'b1) begin
+        stream_tick;
+    end
+
+    if(err != 0) begin
+        wrong_ans;
     end
 
+    //* next case starts after the golden C
+    scanRet = $fseek(in_fd, base_C + 16 * M_golden * nblk_B, 0);
+end endtask
+
+
+task stream_tick; begin
+    @(negedge clk);
+    cycles = cycles + 1;
+    stall = stall + 1;
+    if(stall >= cycle_limit) begin
+        exceed_cycle_limit;
+    end
+end endtask
+
+
+task pulse_blk_valid; begin
+    blk_valid = 1'b1;
+    stream_tick;
+    blk_valid = 1'b0;
+end endtask
+
+
+//* A block a_blk and B block b_blk of pair p, into slot p % 2
+task load_block;
+    input integer p;
+begin
+    a_blk = p % nblk_A;
+    b_blk = p / nblk_A;
+    scanRet = $fseek(in_fd, base_A + 4 * K_golden * a_blk, 0);
+    scanRet = $fread(gbuff_A.gbuff, in_fd, (p % 2) * K_golden, K_golden);
+    scanRet = $fseek(in_fd, base_B + 4 * K_golden * b_blk, 0);
+    scanRet = $fread(gbuff_B.gbuff, in_fd, (p % 2) * K_golden, K_golden);
+end endtask
+
+
+//* tile of pair blk: C rows 4*a_blk.. of column block b_blk, golden C entry
+//* b_blk * M + row
+task tile_check; begin
+    a_blk = blk % nblk_A;
+    b_blk = blk / nblk_A;
+    for(i = 0; i < 4 && 4 * a_blk + i < M_golden; i = i + 1) begin
+        scanRet = $fseek(in_fd, base_C + 16 * (b_blk * M_golden + 4 * a_blk + i), 0);
+        scanRet = $fread(tile_golden, in_fd);
+        if(tile_golden !== gbuff_C.gbuff[(blk % 2) * 4 + i]) begin
+            $display("tile %0d row %0d: gbuff[%0d] = %32h, expect = %32h", blk, 4 * a_blk + i,
+                     (blk % 2) * 4 + i, gbuff_C.gbuff[(blk % 2) * 4 + i], tile_golden);
+            err = err + 1;
+        end
+    end
 end endtask
+`endif
 
 
 task wait_finished; begin
@@ -266,8 +461,8 @@ task wait_finished; begin
     cycles = 0;
     while(busy === 1'b1) begin
         cycles = cycles + 1;
-        if(cycles >= 1500000) begin
-            exceed_1500000_cycles;
+        if(cycles >= cycle_limit) begin
+            exceed_cycle_limit;
         end
         @(negedge clk);
     end
@@ -277,9 +472,9 @@ end endtask
 
 
 
-task exceed_1500000_cycles; begin
+task exceed_cycle_limit; begin
     $display ("------------------------------------------------------------------------------------");
-    $display ("                               exceed 1500000 cycles, (%d) wrong                      ", cycles);
+    $display ("                               exceed %0d cycles, (%d) wrong                          ", cycle_limit, cycles);
     $display ("------------------------------------------------------------------------------------");
     repeat(10)@(negedge clk);
     $finish;
@@ -8,7 +8,11 @@
 
 `timescale 1ns/10ps
 `include "TESTBENCH/PATTERN.v"
+`ifdef TPU_V2
+`include "RTL/TPU_v2.v"
+`else
 `include "RTL/TPU.v"
+`endif
 
 module TESTBENCH;
 
@@ -17,10 +21,13 @@ module TESTBENCH;
 //* CHIP io wires
 wire            clk, rst_n;
 wire            in_valid;
-wire [7:0]      K;
-wire [7:0]      M;
-wire [7:0]      N;
+wire [15:0]     K;
+wire [15:0]     M;
+wire [15:0]     N;
 wire            busy;
+wire            stream;
+wire            blk_valid;
+wire            blk_done;
 wire            A_wr_en;
 wire [15:0]     A_index;
 wire [31:0]     A_data_in;
@@ -59,6 +66,9 @@ PATTERN My_Pattern(
     .M              (M), 
     .N              (N), 
     .busy           (busy),     
+    .stream         (stream),
+    .blk_valid      (blk_valid),
+    .blk_done       (blk_done),
     .A_wr_en        (A_wr_en),         
     .A_index        (A_index),         
     .A_data_in      (A_data_in),         
@@ -84,6 +94,11 @@ TPU My_TPU(
     .M              (M), 
     .N              (N), 
     .busy           (busy),     
+`ifndef TPU_V2
+    .stream         (stream),
+    .blk_valid      (blk_valid),
+    .blk_done       (blk_done),
+`endif
     .A_wr_en        (A_wr_en),         
     .A_index        (A_index),         
     .A_data_in      (A_data_in),         
@@ -1,7 +1,9 @@
 import numpy as np
 import argparse
+import itertools
 import random
 import os
+import struct
 
 
     
@@ -18,18 +20,10 @@ def write_matrix(fd, m):
     malign = np.zeros((r, calign), dtype=np.uint8)
 
     malign[:, 0:c] = m
-    cptr = 0
 
-    fd.write("\n")
+    #* one 32-bit word per row of each 4-column block, column cptr in the MSB
     for cptr in range(0, calign, 4):
-        for dr in range(r):
-            for n in range(4):
-                # t = f"{malign[dr, cptr+n]}"
-                fd.write("{0:2x} ".format(malign[dr, cptr+n]))
-            fd.write('\n')
-            
-
-    fd.write("\n")
+        fd.write(malign[:, cptr:cptr+4].tobytes())
 
     return malign
 
@@ -39,20 +33,13 @@ def write_output_matrix(fd, m):
 
     calign = int((c+3)/4)*4
 
-    malign = np.zeros((r, calign), dtype=np.uint32)
+    malign = np.zeros((r, calign), dtype=">u4")
 
     malign[:, 0:c] = m
-    cptr = 0
 
-    fd.write("\n")
+    #* one 128-bit word per row of each 4-column block, big endian
     for cptr in range(0, calign, 4):
-        for dr in range(r):
-            for n in range(4):
-                # t = f"{malign[dr, cptr+n]}"
-                fd.write("{0:8x} ".format(malign[dr, cptr+n]))
-            fd.write('\n')
-            
-    fd.write("\n")
+        fd.write(malign[:, cptr:cptr+4].tobytes())
 
     return malign
 
@@ -69,10 +56,18 @@ def write_readable(fd, m, desc=""):
 
 def write_config(fd, K, M, N):
 
-    fd.write("{0:3x} {1:3x} {2:3x}".format( K, M, N))
+    fd.write(struct.pack(">III", K, M, N))
+
+
+def case_bytes(K, M, N):
+    """About the bytes one K x M x N case takes in input.bin and check.txt"""
+    ceil4 = lambda v: (v + 3) // 4 * 4
+    binary = 12 + K * ceil4(M) + K * ceil4(N) + 4 * M * ceil4(N)
+    readable = 7 * (M * K + K * N + M * N)
+    return binary + readable
 
 
-def gen_one_case(i, in_fd=None, c_fd=None, all_one=False, mode=0, shape_range=(4, 255), val_range=(0, 255)):
+def gen_one_case(i, in_fd=None, c_fd=None, all_one=False, mode=0, shape_range=(4, 255), val_range=(0, 255), shape=None):
 
     if in_fd == None:
         print("input file descriptor is null")
@@ -98,6 +93,8 @@ def gen_one_case(i, in_fd=None, c_fd=None, all_one=False, mode=0, shape_range=(4
         K = random.randint(shape_range[0], shape_range[1])
         M = random.randint(shape_range[0], shape_range[1])
         N = random.randint(shape_range[0], shape_range[1])
+    elif mode == 4:
+        K, M, N = shape
 
     #* generate the matrix
 
@@ -136,8 +133,13 @@ def main():
 
     parser = argparse.ArgumentParser()
 
-    parser.add_argument('--mode', type=int, required=True, default=0, help="The mode of the generated version")
-    parser.add_argument('--ncases', type=int, required=True, default=1, help="The number of cases to be generated")
+    parser.add_argument('--mode', type=int, required=True, default=0, help="The mode of the generated version, 4 sweeps --K x --M x --N")
+    parser.add_argument('--ncases', type=int, required=True, default=1, help="The number of cases to be generated (per shape in mode 4)")
+    parser.add_argument('--K', type=str, default="4,16,64,255", help="Comma separated K values for mode 4")
+    parser.add_argument('--M', type=str, default="4,16,64,255", help="Comma separated M values for mode 4")
+    parser.add_argument('--N', type=str, default="4,16,64,255", help="Comma separated N values for mode 4")
+    parser.add_argument('--shape_range', type=str, default="4,255", help="min,max of the random K/M/N in modes 2 and 3, up to 65535")
+    parser.add_argument('--max_mb', type=int, default=1024, help="Refuse to write more than this many MB of input.bin + check.txt")
     parser.add_argument('--ones', action="store_true", help="To specify all content of matrix is one")
     parser.add_argument('--target_dir', type=str, required=True, help="The Output directory for testcases")
 
@@ -150,6 +152,32 @@ def main():
     ncases = args.ncases
     all_one = True if args.ones else False
     target_dir = args.target_dir
+    shape_range = tuple(int(v) for v in args.shape_range.split(","))
+
+    #* K, M and N are 16 bits on the TPU
+    if len(shape_range) != 2 or not 1 <= shape_range[0] <= shape_range[1] <= 65535:
+        print(f"--shape_range {args.shape_range}: expected min,max within 1..65535")
+        exit(2)
+
+    if mode == 4:
+        shapes = list(itertools.product(*[[int(v) for v in s.split(",")] for s in (args.K, args.M, args.N)]))
+        shapes = [shape for shape in shapes for _ in range(ncases)]
+        if any(not 1 <= v <= 65535 for shape in shapes for v in shape):
+            print("mode 4 shapes have to be within 1..65535")
+            exit(2)
+        nbytes = sum(case_bytes(*shape) for shape in shapes)
+    else:
+        shapes = [None] * ncases
+        #* random shapes are counted at the top of --shape_range
+        top = shape_range[1]
+        worst = {0: (2, 2, 2), 1: (4, 4, 4), 2: (top, 4, 4)}.get(mode, (top, top, top))
+        nbytes = ncases * case_bytes(*worst)
+
+    #* a 65535 cube alone is tens of GB, and numpy needs as much memory
+    if nbytes > args.max_mb << 20:
+        print(f"up to {nbytes >> 20} MB of patterns, over --max_mb {args.max_mb}; "
+              "shrink the shapes or raise --max_mb")
+        exit(2)
 
 
     try:
@@ -157,16 +185,21 @@ def main():
     except OSError as error:
         print(error)
 
-    input_file = os.path.join(target_dir, "input.txt")
+    input_file = os.path.join(target_dir, "input.bin")
     leg_file   = os.path.join(target_dir, "check.txt")
 
-    in_fd = open(input_file, "w")
+    in_fd = open(input_file, "wb")
     legible_fd = open(leg_file, "w")
 
-    in_fd.write(f"{ncases:d}")
+    #* binary pattern, big endian: case count, then per case K M N (32 bits
+    #* each), A and B as 32-bit words and the golden C as 128-bit words
+    in_fd.write(struct.pack(">I", len(shapes)))
+
+    for n, shape in enumerate(shapes):
+        gen_one_case(n, in_fd, legible_fd, all_one=all_one, mode=mode, shape_range=shape_range, val_range=(0, 255), shape=shape)
 
-    for n in range(ncases):
-        gen_one_case(n, in_fd, legible_fd, all_one=all_one, mode=mode, shape_range=(4, 255), val_range=(0, 255))
+    in_fd.close()
+    legible_fd.close()
 
     # K = 0
     # M = 0
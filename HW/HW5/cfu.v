@@ -12,7 +12,11 @@ module Cfu (
 );
   /* SPEC: funct3 = 0, For write A buffer; funct3 = 1, For write B buffer;
            funct3 = 2, Start compute flag; funct3 = 3, Get results
-           funct3 = 4, For debug A buffer; funct4 = 5, For debug B buffer
+           funct3 = 4, For debug A buffer; funct3 = 5, returns 0 (no debug read of B buffer)
+           funct3 = 6, Weight store: funct7 = 0 set write address (inputs_0, byte address),
+                                     funct7 = 1 write 4 packed int8 weights (inputs_0) and advance
+           funct3 = 7, Set weight base address (inputs_0, byte address) used by compute,
+                       also rewinds the write address so funct3 = 1 streams into the scratch area
   */
   reg signed [7:0] data_in_0, data_in_1;
   reg [1:0] input_offset_enable;
@@ -26,7 +30,8 @@ module Cfu (
   reg signed [31:0] input_offset;
   reg [20:0] cycle_cnt;
   reg [15:0] A_index, B_index, C_index;  // for computation
-  reg [15:0] A_index_dbg, B_index_dbg;  // for debug
+  reg [15:0] B_base;  // weight base address, B_index restarts here after each tile
+  reg [15:0] A_index_dbg;  // for debug
   reg signed [31:0] C_Matrix[0:15];
 
   integer i;
@@ -48,7 +53,6 @@ module Cfu (
       C_index <= 'd0;
       // debug
       A_index_dbg <= 'd0;
-      B_index_dbg <= 'd0;
     end else if (cmd_valid) begin
       if (cmd_payload_function_id[2:0] == 'd0) begin
         store_gbuff_A_enable <= 1;
@@ -76,10 +80,13 @@ module Cfu (
         rsp_payload_outputs_0 <= {{24{gbuff_A[7]}}, gbuff_A[A_index_dbg]};  // sign extension
         A_index_dbg <= A_index_dbg + 'd1;
       end
-      else if (cmd_payload_function_id[2:0] == 'd5) begin
+      else if (cmd_payload_function_id[2:0] == 'd5 || cmd_payload_function_id[2:0] == 'd6 ||
+               cmd_payload_function_id[2:0] == 'd7) begin
+        // Weight store access is handled by the gbuff_B block, respond at once.
+        // funct3 = 5 answers 0: a debug read of gbuff_B would be a second
+        // asynchronous read port and keep the 32KB buffer out of block RAM.
         rsp_valid <= 'd1;
-        rsp_payload_outputs_0 <= {{24{gbuff_B[7]}}, gbuff_B[B_index_dbg]};
-        B_index_dbg <= B_index_dbg + 'd1;
+        rsp_payload_outputs_0 <= 'd0;
       end
     end else if (store_done_flag) begin // (check), need a complete signal
       rsp_valid <= 1;
@@ -90,7 +97,6 @@ module Cfu (
     end else if (comupte_done_flag) begin
       rsp_valid <= 1;
       A_index_dbg <= 'd0;
-      B_index_dbg <= 'd0;
     end
     else begin
       rsp_valid <= 'd0;
@@ -158,22 +164,40 @@ module Cfu (
   end
 
   // Global buffer B for Filter matrix, ADDR_BITS=16, DATA_BITS=32
-  parameter ADDR_BITS_B = 11; //Up to 14
+  // Doubles as the resident weight store: packed weights of every layer are
+  // written once through funct3 = 6 and selected by B_base (funct3 = 7).
+  // Bytes [0, 1200) stay the scratch area for legacy funct3 = 1 streaming.
+  // Sized for the KWS model: its conv and fully connected weights pack to
+  // about 20KB, 32KB leaves headroom at 262144 bits, a quarter of the budget
+  // above. Layers that do not fit stream through funct3 = 1 as before.
+  parameter ADDR_BITS_B = 15; // byte address, 32KB
   parameter DATA_BITS_B = 8;
-  parameter DEPTH_B = 1200;  // 2048 is too large (check)
-  reg signed [DATA_BITS_B-1:0] gbuff_B [DEPTH_B-1:0];
+  parameter WORD_BITS_B = 4 * DATA_BITS_B;  // one word feeds the 4 PE columns
+  parameter DEPTH_B = 2**(ADDR_BITS_B-2);   // in words
+  reg [WORD_BITS_B-1:0] gbuff_B [DEPTH_B-1:0];
   reg [ADDR_BITS_B-1:0] index_B;
   always @ (posedge clk) begin
     if(reset) begin
       index_B <= 'd0;
-      // for(i = 0; i < DEPTH_B; i = i+1) begin
-      //   gbuff_B[i] <= 'd0;          
-      // end
     end
     else begin
-      if(store_gbuff_B_enable) begin // (check)
-        gbuff_B[index_B]   <= data_in_0;
-        gbuff_B[index_B+1] <= data_in_1;
+      if(cmd_valid && cmd_payload_function_id[2:0] == 'd6) begin
+        if(cmd_payload_function_id[3] == 1'b0) begin  // set write address
+          index_B <= cmd_payload_inputs_0[ADDR_BITS_B-1:0];
+        end
+        else begin  // write one packed word
+          gbuff_B[index_B[ADDR_BITS_B-1:2]] <= cmd_payload_inputs_0;
+          index_B <= index_B + 4;
+        end
+      end
+      else if(cmd_valid && cmd_payload_function_id[2:0] == 'd7) begin
+        index_B <= 'd0;  // a funct3 = 6 load may have left it past a resident layer
+      end
+      else if(store_gbuff_B_enable) begin // (check)
+        if(index_B[1] == 1'b0)
+          gbuff_B[index_B[ADDR_BITS_B-1:2]][15:0]  <= {data_in_1, data_in_0};
+        else
+          gbuff_B[index_B[ADDR_BITS_B-1:2]][31:16] <= {data_in_1, data_in_0};
         index_B <= index_B + 2;
       end
       else if(comupte_done_flag) begin  // (May Need modify)
@@ -222,13 +246,22 @@ module Cfu (
       A_index <= 'd0;
   end
 
+  always @(posedge clk) begin
+    if (reset)
+      B_base <= 'd0;
+    else if (cmd_payload_function_id[2:0] == 'd7 && cmd_valid)
+      B_base <= cmd_payload_inputs_0[15:0];
+  end
+
   always @(posedge clk) begin
     if (reset)
       B_index <= 'd0;
+    else if (cmd_payload_function_id[2:0] == 'd7 && cmd_valid)
+      B_index <= cmd_payload_inputs_0[15:0];
     else if (start_compute_flag && cycle_cnt < (K_in -1))
       B_index <= B_index + 'd4;
-    else if (cmd_payload_function_id[2:0] == 'd3 && cmd_valid) // Only after three times computation reset to zero
-      B_index <= 'd0;
+    else if (cmd_payload_function_id[2:0] == 'd3 && cmd_valid) // Only after three times computation reset to base
+      B_index <= B_base;
   end
 
   /* PEs Calculate */
@@ -285,10 +318,8 @@ module Cfu (
       tmp_gbuff_B_3 <= 'd0;
     end
     else begin
-      tmp_gbuff_B_0 <= gbuff_B[B_index];
-      tmp_gbuff_B_1 <= gbuff_B[B_index + 1];
-      tmp_gbuff_B_2 <= gbuff_B[B_index + 2];
-      tmp_gbuff_B_3 <= gbuff_B[B_index + 3];
+      // B_index is always word aligned, a single read feeds all 4 columns
+      {tmp_gbuff_B_3, tmp_gbuff_B_2, tmp_gbuff_B_1, tmp_gbuff_B_0} <= gbuff_B[B_index[ADDR_BITS_B-1:2]];
     end
   end
 
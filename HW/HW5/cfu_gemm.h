@@ -0,0 +1,188 @@
+#ifndef CFU_GEMM_H_
+#define CFU_GEMM_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+
+#include "cfu.h"
+#include "cfu_trace.h"
+#include "cfu_weight_store.h"
+#include "tensorflow/lite/kernels/internal/common.h"
+
+/* Shared int8 GEMM engine on the CFU, C[M][N] = A[M][K] * B[K][N].
+   A holds activations (one row per output position), B the weights (one
+   column per output channel). Every matmul shaped kernel (conv via im2col,
+   fully connected) goes through CfuGemm(), which does the tiling, weight
+   streaming or resident weight lookup, CFU dispatch and requantization.
+*/
+constexpr int kCfuTile = 4;        // PE array is 4 x 4
+constexpr int kCfuMaxDepth = 300;  // gbuff_A holds kCfuTile * K bytes (1200)
+
+struct CfuGemmParams {
+  int rows;     // M, output positions
+  int depth;    // K, accumulation depth
+  int columns;  // N, output channels
+  int32_t input_offset;
+  int32_t output_offset;
+  // Per column when per_channel, otherwise element 0 applies to all columns.
+  const int32_t* output_multiplier;
+  const int32_t* output_shift;
+  bool per_channel;
+  const int32_t* bias;  // may be null
+  int32_t output_activation_min;
+  int32_t output_activation_max;
+};
+
+inline int8_t CfuGemmRequantize(const CfuGemmParams& params, int column,
+                                int32_t acc) {
+  if (params.bias) {
+    acc += params.bias[column];
+  }
+  const int q = params.per_channel ? column : 0;
+  acc = tflite::MultiplyByQuantizedMultiplier(
+      acc, params.output_multiplier[q], params.output_shift[q]);
+  acc += params.output_offset;
+  acc = std::max(acc, params.output_activation_min);
+  acc = std::min(acc, params.output_activation_max);
+  return static_cast<int8_t>(acc);
+}
+
+// Writes two activations to gbuff_A. Bit i of flags marks element i as real
+// data, the CFU adds the input offset to it (zero padding stays 0).
+inline void CfuGemmSendPair(int flags, int8_t a0, int8_t a1) {
+  switch (flags) {  // funct7 has to be an immediate
+    case 0: CFU_OP(0, 0, a0, a1); break;
+    case 1: CFU_OP(0, 1, a0, a1); break;
+    case 2: CFU_OP(0, 2, a0, a1); break;
+    default: CFU_OP(0, 3, a0, a1); break;
+  }
+}
+
+// Legacy path for weights that are not resident: streams column block n0,
+// rows [k0, k0 + kc), into the scratch area of gbuff_B.
+template <typename WeightAt>
+inline void CfuGemmStreamWeights(const CfuGemmParams& params,
+                                 WeightAt& weight_at, int n0, int k0, int kc) {
+  auto w = [&](int k, int n) -> int8_t {
+    return n < params.columns ? weight_at(k, n) : 0;
+  };
+  CFU_OP(7, 0, 0, 0);  // also rewinds the write pointer to the scratch area
+  for (int k = k0; k < k0 + kc; ++k) {
+    CFU_OP(1, 0, w(k, n0), w(k, n0 + 1));
+    CFU_OP(1, 0, w(k, n0 + 2), w(k, n0 + 3));
+  }
+}
+
+// Sends rows [m0, m0 + 4) of A, depth [k0, k0 + kc), k major as the PEs
+// consume it. Rows past M are sent as padding.
+template <typename InputAt>
+inline void CfuGemmSendInputs(const CfuGemmParams& params, InputAt& input_at,
+                              int m0, int k0, int kc) {
+  for (int k = k0; k < k0 + kc; ++k) {
+    for (int m = m0; m < m0 + kCfuTile; m = m + 2) {
+      int8_t a0 = 0;
+      int8_t a1 = 0;
+      int flags = 0;
+      if (m < params.rows && input_at(m, k, &a0)) {
+        flags |= 1;
+      }
+      if (m + 1 < params.rows && input_at(m + 1, k, &a1)) {
+        flags |= 2;
+      }
+      CfuGemmSendPair(flags, a0, a1);
+    }
+  }
+}
+
+// Runs the GEMM on the CFU.
+//   input_at(m, k, int8_t* value) -> bool: raw activation, false for padding
+//   weight_at(k, n) -> int8_t:             only used when weight_base < 0
+//   store(m, n, int8_t):                   receives each requantized output
+// weight_base is the address returned by CfuRegisterWeights(), or -1 to
+// stream the weights through cfu_op1 on every call.
+template <typename InputAt, typename WeightAt, typename OutputStore>
+inline void CfuGemm(const CfuGemmParams& params, int32_t weight_base,
+                    InputAt input_at, WeightAt weight_at, OutputStore store) {
+  const int num_chunks = (params.depth + kCfuMaxDepth - 1) / kCfuMaxDepth;
+  CfuTraceMark(weight_base >= 0 ? kCfuTracePhaseGemm
+                                : kCfuTracePhaseGemmStreamed,
+               params.rows, params.depth, params.columns);
+  for (int n0 = 0; n0 < params.columns; n0 = n0 + kCfuTile) {
+    // A single K chunk reuses the streamed block for every row tile.
+    if (weight_base < 0 && num_chunks == 1) {
+      CfuGemmStreamWeights(params, weight_at, n0, 0, params.depth);
+    }
+    for (int m0 = 0; m0 < params.rows; m0 = m0 + kCfuTile) {
+      int32_t acc[kCfuTile * kCfuTile] = {0};
+      for (int k0 = 0; k0 < params.depth; k0 = k0 + kCfuMaxDepth) {
+        const int kc = std::min(kCfuMaxDepth, params.depth - k0);
+        if (weight_base >= 0) {
+          CFU_OP(7, 0, weight_base + n0 * params.depth + k0 * kCfuTile, 0);
+        } else if (num_chunks > 1) {
+          CfuGemmStreamWeights(params, weight_at, n0, k0, kc);
+        }
+        CfuGemmSendInputs(params, input_at, m0, k0, kc);
+        CFU_OP(2, 0, kc, params.input_offset);  // Start compute trigger!
+        for (int i = 0; i < kCfuTile * kCfuTile; ++i) {
+          acc[i] += CFU_OP(3, 0, 0, 0);  // C[4 * row + column]
+        }
+      }
+
+#ifdef CFU_GEMM_CHECK
+      // Checking answer against the CPU
+      for (int x = 0; x < kCfuTile && m0 + x < params.rows; ++x) {
+        for (int y = 0; y < kCfuTile && n0 + y < params.columns; ++y) {
+          int32_t expect = 0;
+          for (int k = 0; k < params.depth; ++k) {
+            int8_t a = 0;
+            if (input_at(m0 + x, k, &a)) {
+              expect += (a + params.input_offset) * weight_at(k, n0 + y);
+            }
+          }
+          if (expect != acc[x * kCfuTile + y]) {
+            printf("\nAnswer Not Equal m = %d, n = %d, CPU = %ld, HW = %ld\n",
+                   m0 + x, n0 + y, static_cast<long>(expect),
+                   static_cast<long>(acc[x * kCfuTile + y]));
+          }
+        }
+      }
+#endif
+
+      for (int x = 0; x < kCfuTile && m0 + x < params.rows; ++x) {
+        for (int y = 0; y < kCfuTile && n0 + y < params.columns; ++y) {
+          store(m0 + x, n0 + y,
+                CfuGemmRequantize(params, n0 + y, acc[x * kCfuTile + y]));
+        }
+      }
+    }
+  }
+}
+
+// Same contract and output order as CfuGemm() but on the CPU, so a layer can
+// keep the im2col GEMM without offloading it.
+template <typename InputAt, typename WeightAt, typename OutputStore>
+inline void CpuGemm(const CfuGemmParams& params, InputAt input_at,
+                    WeightAt weight_at, OutputStore store) {
+  for (int n0 = 0; n0 < params.columns; n0 = n0 + kCfuTile) {
+    const int nc = std::min(kCfuTile, params.columns - n0);
+    for (int m = 0; m < params.rows; ++m) {
+      int32_t acc[kCfuTile] = {0};
+      for (int k = 0; k < params.depth; ++k) {
+        int8_t a = 0;
+        if (!input_at(m, k, &a)) {
+          continue;
+        }
+        const int32_t input_val = a + params.input_offset;
+        for (int y = 0; y < nc; ++y) {
+          acc[y] += input_val * weight_at(k, n0 + y);
+        }
+      }
+      for (int y = 0; y < nc; ++y) {
+        store(m, n0 + y, CfuGemmRequantize(params, n0 + y, acc[y]));
+      }
+    }
+  }
+}
+
+#endif  // CFU_GEMM_H_
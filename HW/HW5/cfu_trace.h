@@ -0,0 +1,146 @@
+#ifndef CFU_TRACE_H_
+#define CFU_TRACE_H_
+
+#include <cstdint>
+#include <cstdio>
+
+#include "cfu.h"
+#include "perf.h"
+
+/* CFU command trace.
+
+   Every CFU command of the driver goes through CFU_OP(funct3, funct7, in0,
+   in1). Built with CFU_TRACE defined, CFU_OP also appends one 20 byte record
+   (issue cycle, function id, both operands, response, response latency) to a
+   ring buffer of CFU_TRACE_ENTRIES records; without it CFU_OP is exactly
+   cfu_opN() and the trace calls below compile to nothing.
+
+   CfuTraceMark() drops a marker record at the start of each driver phase
+   (weight registration, one GEMM) so the host can split the stream.
+   CfuTraceDump() writes the ring, oldest record first, to the console as the
+   raw record bytes in hex (the console would mangle a raw 0x0a byte); feed
+   the log to cfu_trace.py to summarize it or replay it against the Cfu.
+
+   The default ring is 128K records, 2.5MB of .bss, enough for one 25x5x64
+   pointwise conv of the KWS model (about 75K commands). Call CfuTraceReset()
+   right before the layer of interest. A ring that wrapped cannot be replayed,
+   the Cfu state before the first kept record is lost.
+
+   The timestamps include the tracing itself, a few tens of cycles per command.
+*/
+#ifndef CFU_TRACE_ENTRIES
+#define CFU_TRACE_ENTRIES (128 * 1024)
+#endif
+
+// Records per cfu_trace_bin line of CfuTraceDump().
+constexpr int kCfuTraceRecordsPerLine = 4;
+
+// Marker records use this function id, real ids are 10 bits.
+constexpr uint16_t kCfuTraceMarker = 0xffff;
+
+enum CfuTracePhase : uint32_t {
+  kCfuTracePhaseWeights = 1,        // CfuRegisterWeights()
+  kCfuTracePhaseGemm = 2,           // CfuGemm() on resident weights
+  kCfuTracePhaseGemmStreamed = 3,   // CfuGemm() streaming through cfu_op1
+};
+
+// Little endian on the target, cfu_trace.py reads the same layout.
+struct CfuTraceRecord {
+  uint32_t cycle;        // mcycle when the command was issued
+  uint32_t inputs_0;     // marker: phase
+  uint32_t inputs_1;     // marker: rows (M)
+  uint32_t output;       // marker: depth (K) << 16 | columns (N)
+  uint16_t function_id;  // {funct7, funct3} as cmd_payload_function_id
+  uint16_t latency;      // cycles until the response, saturates at 0xffff
+};
+static_assert(sizeof(CfuTraceRecord) == 20, "trace record layout changed");
+
+#ifdef CFU_TRACE
+struct CfuTraceBuffer {
+  CfuTraceRecord records[CFU_TRACE_ENTRIES];
+  uint32_t total = 0;  // records ever appended, the ring keeps the last ones
+};
+
+inline CfuTraceBuffer& GetCfuTraceBuffer() {
+  static CfuTraceBuffer buffer;
+  return buffer;
+}
+
+inline void CfuTraceAppend(uint16_t function_id, uint32_t cycle,
+                           uint32_t inputs_0, uint32_t inputs_1,
+                           uint32_t output, uint32_t latency) {
+  CfuTraceBuffer& buffer = GetCfuTraceBuffer();
+  CfuTraceRecord& record = buffer.records[buffer.total % CFU_TRACE_ENTRIES];
+  record.cycle = cycle;
+  record.inputs_0 = inputs_0;
+  record.inputs_1 = inputs_1;
+  record.output = output;
+  record.function_id = function_id;
+  record.latency = latency > 0xffff ? 0xffff : latency;
+  buffer.total++;
+}
+
+inline void CfuTraceMark(CfuTracePhase phase, int rows, int depth,
+                         int columns) {
+  CfuTraceAppend(kCfuTraceMarker, perf_get_mcycle(), phase, rows,
+                 (static_cast<uint32_t>(depth) << 16) |
+                     (static_cast<uint32_t>(columns) & 0xffff),
+                 0);
+}
+
+inline void CfuTraceReset() { GetCfuTraceBuffer().total = 0; }
+
+inline void CfuTraceDump() {
+  const CfuTraceBuffer& buffer = GetCfuTraceBuffer();
+  const uint32_t kept =
+      buffer.total < CFU_TRACE_ENTRIES ? buffer.total : CFU_TRACE_ENTRIES;
+  static const char kHex[] = "0123456789abcdef";
+  char line[sizeof("cfu_trace_bin ") - 1 +
+            2 * sizeof(CfuTraceRecord) * kCfuTraceRecordsPerLine + 2];
+  printf("CFU_TRACE begin %lu %lu\n", static_cast<unsigned long>(buffer.total),
+         static_cast<unsigned long>(kept));
+  uint32_t i = buffer.total - kept;
+  while (i != buffer.total) {
+    char* p = line;
+    for (const char* s = "cfu_trace_bin "; *s; ++s) {
+      *p++ = *s;
+    }
+    for (int n = 0; n < kCfuTraceRecordsPerLine && i != buffer.total;
+         ++n, ++i) {
+      const uint8_t* bytes = reinterpret_cast<const uint8_t*>(
+          &buffer.records[i % CFU_TRACE_ENTRIES]);
+      for (size_t b = 0; b < sizeof(CfuTraceRecord); ++b) {
+        *p++ = kHex[bytes[b] >> 4];
+        *p++ = kHex[bytes[b] & 0xf];
+      }
+    }
+    *p++ = '\n';
+    *p = '\0';
+    fputs(line, stdout);
+  }
+  printf("CFU_TRACE end\n");
+}
+
+// funct7 stays a literal inside the lambda, cfu_opN needs an immediate.
+#define CFU_OP(funct3, funct7, in0, in1)                                  \
+  ([&]() {                                                                \
+    const uint32_t cfu_trace_in0 = (in0);                                 \
+    const uint32_t cfu_trace_in1 = (in1);                                 \
+    const uint32_t cfu_trace_start = perf_get_mcycle();                   \
+    const auto cfu_trace_rsp =                                            \
+        cfu_op##funct3(funct7, cfu_trace_in0, cfu_trace_in1);             \
+    const uint32_t cfu_trace_finish = perf_get_mcycle();                  \
+    CfuTraceAppend(((funct7) << 3) | (funct3), cfu_trace_start,           \
+                   cfu_trace_in0, cfu_trace_in1, cfu_trace_rsp,           \
+                   cfu_trace_finish - cfu_trace_start);                   \
+    return cfu_trace_rsp;                                                 \
+  }())
+#else
+#define CFU_OP(funct3, funct7, in0, in1) cfu_op##funct3(funct7, in0, in1)
+
+inline void CfuTraceMark(CfuTracePhase, int, int, int) {}
+inline void CfuTraceReset() {}
+inline void CfuTraceDump() {}
+#endif  // CFU_TRACE
+
+#endif  // CFU_TRACE_H_
@@ -0,0 +1,389 @@
+"""Summarize and replay CFU command traces.
+
+A trace comes from CfuTraceDump() in a CFU_TRACE build (see cfu_trace.h),
+save the console log and pass it here. The log carries the raw
+CfuTraceRecord bytes in hex; raw little endian dumps of the record array
+(20 bytes per record) are accepted as well.
+
+    python3 cfu_trace.py console.log                     # summary
+    python3 cfu_trace.py console.log --replay model      # + software Cfu model
+    python3 cfu_trace.py console.log --replay iverilog   # + cfu.v in iverilog
+
+The replay feeds every command back to the Cfu and checks the responses
+(funct3 = 3/4/5) against the captured ones. The iverilog replay also reports
+how many cycles the hardware itself needs per command, the rest of the
+captured latency is spent in the CPU and on the bus.
+"""
+
+import argparse
+import collections
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+
+MARKER = 0xffff
+RECORD = struct.Struct("<IIIIHH")  # CfuTraceRecord
+WEIGHT_STORE_BYTES = 1 << 15  # ADDR_BITS_B in cfu.v
+B_ADDR_MASK = WEIGHT_STORE_BYTES - 1
+B_WORD_MASK = WEIGHT_STORE_BYTES // 4 - 1
+
+PHASE_NAMES = {
+    0: "untagged",
+    1: "weights",
+    2: "gemm",
+    3: "gemm (streamed)",
+}
+
+Record = collections.namedtuple(
+    "Record", "cycle function_id inputs_0 inputs_1 output latency")
+
+
+def funct3(function_id):
+    return function_id & 0x7
+
+
+def funct7(function_id):
+    return function_id >> 3
+
+
+def command_name(function_id):
+    f3 = funct3(function_id)
+    if f3 == 6:
+        return "weight write" if funct7(function_id) & 1 else "weight addr"
+    return ["write A", "write B", "compute", "read C",
+            "debug A", "debug B", None, "set B base"][f3]
+
+
+def bytes_moved(function_id):
+    """Payload bytes (to the CFU, from the CFU) of one command."""
+    f3 = funct3(function_id)
+    if f3 in (0, 1):
+        return 2, 0
+    if f3 == 6 and funct7(function_id) & 1:
+        return 4, 0
+    if f3 in (3, 4, 5):
+        return 0, 4
+    return 0, 0
+
+
+def load_trace(path):
+    """Returns (records, total issued)."""
+    with open(path, "rb") as fd:
+        data = fd.read()
+
+    if b"CFU_TRACE begin" not in data:
+        if len(data) % RECORD.size:
+            sys.exit(f"{path}: not a console log and not a whole number of records")
+        records = [Record(cycle, fid, in0, in1, out, lat)
+                   for cycle, in0, in1, out, fid, lat in RECORD.iter_unpack(data)]
+        return records, len(records)
+
+    records = []
+    total = None
+    for line in data.decode("ascii", "replace").splitlines():
+        line = line.strip()
+        if line.startswith("CFU_TRACE begin"):
+            records = []  # keep the last dump in the log
+            total = int(line.split()[2])
+        elif line.startswith("cfu_trace_bin "):
+            try:
+                raw = bytes.fromhex(line.split()[1])
+            except (IndexError, ValueError):
+                raw = b""
+            if not raw or len(raw) % RECORD.size:
+                print(f"skipping garbled line: {line}", file=sys.stderr)
+                continue
+            records.extend(Record(cycle, fid, in0, in1, out, lat)
+                           for cycle, in0, in1, out, fid, lat
+                           in RECORD.iter_unpack(raw))
+    return records, total
+
+
+def split_phases(records):
+    """Splits the trace at the marker records.
+
+    Returns a list of dicts: kind, shape and the command indices of each phase.
+    """
+    phases = [{"kind": 0, "shape": None, "start": None, "commands": []}]
+    for i, r in enumerate(records):
+        if r.function_id == MARKER:
+            shape = (r.inputs_1, r.output >> 16, r.output & 0xffff)
+            phases.append({"kind": r.inputs_0, "shape": shape,
+                           "start": r.cycle, "commands": []})
+        else:
+            phases[-1]["commands"].append(i)
+    return [p for p in phases if p["commands"]]
+
+
+def gaps(records):
+    """Cycles from each response to the next command, keyed by command index."""
+    out = {}
+    prev = None
+    for i, r in enumerate(records):
+        if r.function_id == MARKER:
+            continue
+        if prev is not None:
+            p = records[prev]
+            out[prev] = (r.cycle - p.cycle - p.latency) & 0xffffffff
+        prev = i
+    return out
+
+
+def summarize(records, total, gap_threshold, top, hw_latency=None):
+    commands = [i for i, r in enumerate(records) if r.function_id != MARKER]
+    if not commands:
+        print("empty trace")
+        return
+    first = records[commands[0]]
+    last = records[commands[-1]]
+    span = (last.cycle + last.latency - first.cycle) & 0xffffffff
+    print(f"trace: {len(commands)} commands, {span} cycles")
+    if total is not None and total > len(records):
+        print(f"  ring wrapped, {total - len(records)} older records lost")
+
+    # Command mix
+    print("\ncommand mix")
+    print(f"  {'command':<14}{'count':>9}{'%':>7}{'cycles':>12}{'avg':>8}"
+          + (f"{'hw avg':>8}" if hw_latency else ""))
+    mix = collections.OrderedDict()
+    for i in commands:
+        r = records[i]
+        m = mix.setdefault(command_name(r.function_id), [0, 0, 0])
+        m[0] += 1
+        m[1] += r.latency
+        if hw_latency:
+            m[2] += hw_latency[i]
+    for name, (count, cycles, hw) in sorted(mix.items(), key=lambda x: -x[1][1]):
+        line = (f"  {name:<14}{count:>9}{100.0 * count / len(commands):>6.1f}%"
+                f"{cycles:>12}{cycles / count:>8.1f}")
+        if hw_latency:
+            line += f"{hw / count:>8.1f}"
+        print(line)
+
+    # Phases
+    gap = gaps(records)
+    phases = split_phases(records)
+    per_kind = collections.OrderedDict()
+    for p in phases:
+        cmds = p["commands"]
+        begin = p["start"] if p["start"] is not None else records[cmds[0]].cycle
+        end = records[cmds[-1]].cycle + records[cmds[-1]].latency
+        p["cycles"] = (end - begin) & 0xffffffff
+        p["busy"] = sum(records[i].latency for i in cmds)
+        p["in"] = sum(bytes_moved(records[i].function_id)[0] for i in cmds)
+        p["out"] = sum(bytes_moved(records[i].function_id)[1] for i in cmds)
+        k = per_kind.setdefault(PHASE_NAMES.get(p["kind"], str(p["kind"])),
+                                [0, 0, 0, 0, 0, 0])
+        for j, v in enumerate((1, len(cmds), p["cycles"], p["busy"],
+                               p["in"], p["out"])):
+            k[j] += v
+
+    print("\nper phase (busy = waiting on the CFU, idle = CPU between commands)")
+    print(f"  {'phase':<16}{'count':>6}{'commands':>10}{'cycles':>11}"
+          f"{'busy %':>8}{'bytes in':>10}{'bytes out':>10}{'B/kcycle':>10}")
+    for name, (count, ncmds, cycles, busy, bin_, bout) in per_kind.items():
+        print(f"  {name:<16}{count:>6}{ncmds:>10}{cycles:>11}"
+              f"{100.0 * busy / max(cycles, 1):>7.1f}%{bin_:>10}{bout:>10}"
+              f"{1000.0 * (bin_ + bout) / max(cycles, 1):>10.1f}")
+
+    print("\nslowest phases")
+    for p in sorted(phases, key=lambda p: -p["cycles"])[:top]:
+        shape = ""
+        if p["shape"]:
+            rows, depth, columns = p["shape"]
+            shape = f"M {rows} K {depth} N {columns}" if rows else f"K {depth} N {columns}"
+        print(f"  {PHASE_NAMES.get(p['kind'], p['kind']):<16}{shape:<24}"
+              f"{p['cycles']:>10} cycles, busy {100.0 * p['busy'] / max(p['cycles'], 1):.1f}%,"
+              f" {p['in'] + p['out']} bytes")
+
+    # Idle gaps
+    print("\nidle gaps (cycles from a response to the next command)")
+    buckets = [(0, 15), (16, 63), (64, 255), (256, 1023), (1024, None)]
+    for lo, hi in buckets:
+        sel = [g for g in gap.values() if g >= lo and (hi is None or g <= hi)]
+        label = f"{lo}-{hi}" if hi is not None else f"{lo}+"
+        print(f"  {label:<12}{len(sel):>9} gaps {sum(sel):>12} cycles")
+    phase_of = {}
+    for n, p in enumerate(phases):
+        for i in p["commands"]:
+            phase_of[i] = n
+    stalls = sorted((g, i) for i, g in gap.items() if g >= gap_threshold)
+    print(f"  {len(stalls)} gaps of {gap_threshold}+ cycles, largest:")
+    for g, i in reversed(stalls[-top:]):
+        p = phases[phase_of[i]]
+        print(f"    after #{i:<8}{command_name(records[i].function_id):<14}"
+              f"{g:>10} cycles  in {PHASE_NAMES.get(p['kind'], p['kind'])}"
+              f" #{phase_of[i]}")
+
+
+class CfuModel:
+    """Software model of Cfu in cfu.v, at the level the driver relies on."""
+
+    def __init__(self):
+        self.gbuff_A = [0] * 1200
+        self.offset_map = [False] * 1200
+        self.index_A = 0
+        self.gbuff_B = [0] * (WEIGHT_STORE_BYTES // 4)
+        self.index_B = 0
+        self.B_base = 0
+        self.B_index = 0
+        self.C = [0] * 16
+        self.C_index = 0
+        self.A_index_dbg = 0
+
+    @staticmethod
+    def s8(v):
+        v &= 0xff
+        return v - 256 if v & 0x80 else v
+
+    def command(self, function_id, in0, in1):
+        f3 = funct3(function_id)
+        f7 = funct7(function_id)
+        if f3 == 0:
+            for j, v in enumerate((in0, in1)):
+                self.gbuff_A[self.index_A + j] = self.s8(v)
+                self.offset_map[self.index_A + j] = bool(f7 >> j & 1)
+            self.index_A += 2
+            self.C = [0] * 16
+            self.C_index = 0
+        elif f3 == 1:
+            half = (in0 & 0xff) | (in1 & 0xff) << 8
+            w = self.index_B >> 2 & B_WORD_MASK
+            if self.index_B & 2:
+                self.gbuff_B[w] = self.gbuff_B[w] & 0xffff | half << 16
+            else:
+                self.gbuff_B[w] = self.gbuff_B[w] & 0xffff0000 | half
+            self.index_B = (self.index_B + 2) & B_ADDR_MASK
+            self.C = [0] * 16
+            self.C_index = 0
+        elif f3 == 2:
+            k_in = in0 & 0x1ff
+            offset = in1 - (1 << 32) if in1 & 0x80000000 else in1
+            for k in range(k_in):
+                word = self.gbuff_B[self.B_index >> 2 & B_WORD_MASK]
+                for x in range(4):
+                    i = (4 * k + x) % len(self.gbuff_A)
+                    a = self.gbuff_A[i]
+                    if self.offset_map[i]:
+                        a += offset
+                    for y in range(4):
+                        self.C[4 * x + y] += a * self.s8(word >> (8 * y))
+                self.B_index = (self.B_index + 4) & 0xffff
+            self.index_A = 0
+            self.index_B = 0
+            self.A_index_dbg = 0
+        elif f3 == 3:
+            out = self.C[self.C_index & 0xf] & 0xffffffff
+            self.C_index += 1
+            self.B_index = self.B_base
+            return out
+        elif f3 == 4:
+            out = self.gbuff_A[self.A_index_dbg % 1200] & 0xffffffff
+            self.A_index_dbg += 1
+            return out
+        elif f3 == 5:
+            return 0
+        elif f3 == 6:
+            if f7 & 1:
+                self.gbuff_B[self.index_B >> 2 & B_WORD_MASK] = in0 & 0xffffffff
+                self.index_B = (self.index_B + 4) & B_ADDR_MASK
+            else:
+                self.index_B = in0 & B_ADDR_MASK
+        elif f3 == 7:
+            self.B_base = self.B_index = in0 & 0xffff
+            self.index_B = 0
+        return 0
+
+
+def checked(function_id):
+    return funct3(function_id) in (3, 4, 5)
+
+
+def report_mismatches(records, got):
+    errors = 0
+    for i, r in enumerate(records):
+        if i in got and checked(r.function_id) and got[i] != r.output:
+            if errors < 16:
+                print(f"  MISMATCH #{i} {command_name(r.function_id)}: "
+                      f"replay {got[i]:08x}, captured {r.output:08x}")
+            errors += 1
+    return errors
+
+
+def replay_model(records):
+    model = CfuModel()
+    got = {}
+    for i, r in enumerate(records):
+        if r.function_id != MARKER:
+            got[i] = model.command(r.function_id, r.inputs_0, r.inputs_1)
+    errors = report_mismatches(records, got)
+    print(f"\nmodel replay: {len(got)} commands, {errors} mismatches")
+
+
+def replay_iverilog(records, max_cmds=1 << 18):
+    here = os.path.dirname(os.path.abspath(__file__))
+    index = [i for i, r in enumerate(records) if r.function_id != MARKER]
+    if len(index) > max_cmds:
+        sys.exit(f"{len(index)} commands, cfu_trace_tb.v holds {max_cmds}")
+
+    with tempfile.TemporaryDirectory() as tmp:
+        stimulus = os.path.join(tmp, "cfu_trace.hex")
+        latency = os.path.join(tmp, "cfu_trace_latency.txt")
+        sim = os.path.join(tmp, "cfu_trace_sim")
+        with open(stimulus, "w") as fd:
+            for i in index:
+                r = records[i]
+                check = 0x8000 if checked(r.function_id) else 0
+                fd.write(f"{check | r.function_id:04x}{r.inputs_0:08x}"
+                         f"{r.inputs_1:08x}{r.output:08x}\n")
+
+        subprocess.run(["iverilog", "-o", sim,
+                        os.path.join(here, "cfu_trace_tb.v"),
+                        os.path.join(here, "cfu.v")], check=True)
+        result = subprocess.run(["vvp", sim, f"+trace={stimulus}",
+                                 f"+n={len(index)}", f"+latency={latency}"],
+                                check=True, capture_output=True, text=True)
+        print()
+        for line in result.stdout.splitlines():
+            if line.startswith(("MISMATCH", "DONE")):
+                print(f"iverilog replay: {line}")
+
+        with open(latency) as fd:
+            cycles = [int(x) for x in fd.read().split()]
+    return dict(zip(index, cycles))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("trace", help="console log with a CfuTraceDump(), or a raw record dump")
+    parser.add_argument("--replay", choices=["model", "iverilog"], help="replay the commands and check the responses")
+    parser.add_argument("--gap", type=int, default=64, help="report idle gaps of at least this many cycles")
+    parser.add_argument("--top", type=int, default=10, help="entries in the slowest phase / largest gap lists")
+    parser.add_argument("--force", action="store_true", help="replay a trace whose ring wrapped anyway")
+    args = parser.parse_args()
+
+    records, total = load_trace(args.trace)
+    if args.replay and total is not None and total > len(records):
+        # The Cfu state before the first kept record is lost, the replay
+        # would report mismatches that are not there.
+        message = (f"the ring wrapped, {total - len(records)} of {total} "
+                   f"records lost; rebuild with -DCFU_TRACE_ENTRIES={total} "
+                   "or call CfuTraceReset() closer to the layer")
+        if not args.force:
+            sys.exit(f"{args.trace}: {message}")
+        print(f"warning: {message}", file=sys.stderr)
+
+    hw_latency = None
+    if args.replay == "model":
+        replay_model(records)
+    elif args.replay == "iverilog":
+        hw_latency = replay_iverilog(records)
+    print()
+    summarize(records, total, args.gap, args.top, hw_latency)
+
+
+if __name__ == "__main__":
+    main()
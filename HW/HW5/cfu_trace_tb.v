@@ -0,0 +1,104 @@
+//============================================================================//
+// file: cfu_trace_tb.v                                                       //
+// description: replays a captured CFU command trace against Cfu (cfu.v)      //
+//              stimulus and checks are generated by cfu_trace.py             //
+//============================================================================//
+
+`timescale 1ns/10ps
+`define CYCLE_TIME 20.0
+
+module cfu_trace_tb;
+
+  /* Stimulus, one command per line, 112 bits:
+       [111]     compare the response against [31:0]
+       [105:96]  function id
+       [95:64]   inputs_0
+       [63:32]   inputs_1
+       [31:0]    expected response
+  */
+  parameter MAX_CMDS = 1 << 18;  // cfu_trace.py checks the trace fits
+  reg [111:0] cmds [0:MAX_CMDS-1];
+
+  reg          clk;
+  reg          reset;
+  reg          cmd_valid;
+  wire         cmd_ready;
+  reg  [9:0]   cmd_payload_function_id;
+  reg  [31:0]  cmd_payload_inputs_0;
+  reg  [31:0]  cmd_payload_inputs_1;
+  wire         rsp_valid;
+  reg          rsp_ready;
+  wire [31:0]  rsp_payload_outputs_0;
+
+  Cfu u_cfu(
+    .cmd_valid               (cmd_valid),
+    .cmd_ready               (cmd_ready),
+    .cmd_payload_function_id (cmd_payload_function_id),
+    .cmd_payload_inputs_0    (cmd_payload_inputs_0),
+    .cmd_payload_inputs_1    (cmd_payload_inputs_1),
+    .rsp_valid               (rsp_valid),
+    .rsp_ready               (rsp_ready),
+    .rsp_payload_outputs_0   (rsp_payload_outputs_0),
+    .reset                   (reset),
+    .clk                     (clk)
+  );
+
+  always #(`CYCLE_TIME/2.0) clk = ~clk;
+
+  reg [8*256-1:0] trace_file, latency_file;
+  integer ncmds, latency_fd;
+  integer n, cycles, errors, total_cycles;
+
+  initial begin
+    if (!$value$plusargs("trace=%s", trace_file) ||
+        !$value$plusargs("n=%d", ncmds) ||
+        !$value$plusargs("latency=%s", latency_file)) begin
+      $display("usage: vvp cfu_trace_sim +trace=<hex> +n=<commands> +latency=<out>");
+      $finish;
+    end
+    $readmemh(trace_file, cmds, 0, ncmds - 1);
+    latency_fd = $fopen(latency_file, "w");
+
+    clk = 0;
+    reset = 1;
+    cmd_valid = 0;
+    rsp_ready = 1;
+    cmd_payload_function_id = 0;
+    cmd_payload_inputs_0 = 0;
+    cmd_payload_inputs_1 = 0;
+    errors = 0;
+    total_cycles = 0;
+    repeat (4) @(negedge clk);
+    reset = 0;
+    @(negedge clk);
+
+    for (n = 0; n < ncmds; n = n + 1) begin
+      cmd_valid = 1;
+      cmd_payload_function_id = cmds[n][105:96];
+      cmd_payload_inputs_0 = cmds[n][95:64];
+      cmd_payload_inputs_1 = cmds[n][63:32];
+      @(negedge clk);
+      cmd_valid = 0;
+      cycles = 1;
+      while (!rsp_valid) begin
+        @(negedge clk);
+        cycles = cycles + 1;
+      end
+      if (cmds[n][111] && rsp_payload_outputs_0 !== cmds[n][31:0]) begin
+        if (errors < 16)
+          $display("MISMATCH %0d function_id %h got %h expect %h", n,
+                   cmds[n][105:96], rsp_payload_outputs_0, cmds[n][31:0]);
+        errors = errors + 1;
+      end
+      $fdisplay(latency_fd, "%0d", cycles);
+      total_cycles = total_cycles + cycles;
+      @(negedge clk);  // rsp_valid drops before the next command
+      total_cycles = total_cycles + 1;
+    end
+
+    $fclose(latency_fd);
+    $display("DONE %0d commands, %0d cycles, %0d errors", ncmds, total_cycles, errors);
+    $finish;
+  end
+
+endmodule
@@ -0,0 +1,139 @@
+#ifndef CFU_WEIGHT_STORE_H_
+#define CFU_WEIGHT_STORE_H_
+
+#include <cstdint>
+
+#include "cfu_trace.h"
+
+/* Driver for the resident weight store in gbuff_B (see funct3 = 6/7 in cfu.v).
+   Each layer packs its K x N weight matrix once, 4 output columns per 32-bit
+   word, and Eval only points the CFU at the layer's base address.
+
+   Byte layout of the store:
+     [0, kCfuWeightScratchBytes)                    legacy cfu_op1 streaming
+     [kCfuWeightScratchBytes, kCfuWeightStoreBytes) resident layer weights
+
+   The store is 32KB (ADDR_BITS_B = 15 in cfu.v), about 31KB of it for
+   resident weights in up to 32 layers. The KWS model needs about 20KB. A
+   layer that does not fit is recorded as spilled and keeps streaming; to
+   size the store for another model, read spilled_bytes after the first
+   inference.
+*/
+constexpr uint32_t kCfuWeightStoreBytes = 32768;
+constexpr uint32_t kCfuWeightScratchBytes = 1200;
+constexpr int kCfuMaxResidentLayers = 32;
+
+struct CfuResidentWeights {
+  const void* key;  // weight tensor data, stable for the life of the model
+  int32_t base;     // byte address in the weight store, -1 if spilled
+  int depth;        // K, rows of the weight matrix
+  int columns;      // N, output channels
+};
+
+struct CfuWeightTable {
+  CfuResidentWeights layers[kCfuMaxResidentLayers];
+  int num_layers = 0;
+  uint32_t next_free = kCfuWeightScratchBytes;
+  uint32_t spilled_bytes = 0;  // packed size of the spilled layers
+};
+
+inline CfuWeightTable& GetCfuWeightTable() {
+  static CfuWeightTable table;
+  return table;
+}
+
+// Size in bytes a K x N matrix takes in the store, N padded to 4 columns.
+inline uint32_t CfuPackedWeightBytes(int depth, int columns) {
+  return static_cast<uint32_t>(depth) * ((columns + 3) / 4) * 4;
+}
+
+// Returns the table entry for `key`, resident or spilled, or nullptr.
+inline const CfuResidentWeights* CfuFindWeights(const void* key) {
+  const CfuWeightTable& table = GetCfuWeightTable();
+  for (int i = 0; i < table.num_layers; ++i) {
+    if (table.layers[i].key == key) {
+      return &table.layers[i];
+    }
+  }
+  return nullptr;
+}
+
+// Returns the base address of the weights registered under `key`, or -1 if
+// they are unknown or spilled.
+inline int32_t CfuLookupWeights(const void* key) {
+  const CfuResidentWeights* layer = CfuFindWeights(key);
+  return layer ? layer->base : -1;
+}
+
+// Packs a K x N weight matrix, weight_at(k, n), into the CFU weight store and
+// returns its base address. Meant to be called once per layer from Prepare;
+// registering the same key again returns the existing address. Returns -1 if
+// the store is full, the caller then streams through cfu_op1. The layer is
+// recorded as spilled so later calls return -1 without counting it again;
+// if the table itself is full it is neither recorded nor counted.
+//
+// Column block j (4 output channels) lives at base + j * K * 4, one word per
+// k with channel 4j+c in byte c, matching what cfu_op1 writes for one block.
+template <typename WeightAt>
+inline int32_t CfuRegisterWeights(const void* key, int depth, int columns,
+                                  WeightAt weight_at) {
+  const CfuResidentWeights* existing = CfuFindWeights(key);
+  if (existing) {
+    return existing->base;
+  }
+
+  CfuWeightTable& table = GetCfuWeightTable();
+  if (table.num_layers == kCfuMaxResidentLayers) {
+    return -1;
+  }
+  CfuResidentWeights& layer = table.layers[table.num_layers++];
+  layer.key = key;
+  layer.base = -1;
+  layer.depth = depth;
+  layer.columns = columns;
+
+  const uint32_t bytes = CfuPackedWeightBytes(depth, columns);
+  if (table.next_free + bytes > kCfuWeightStoreBytes) {
+    table.spilled_bytes += bytes;
+    return -1;
+  }
+
+  const uint32_t base = table.next_free;
+  CfuTraceMark(kCfuTracePhaseWeights, 0, depth, columns);
+  CFU_OP(6, 0, base, 0);  // set write address
+  for (int j = 0; j < columns; j = j + 4) {
+    for (int k = 0; k < depth; ++k) {
+      uint32_t word = 0;
+      for (int c = 0; c < 4; ++c) {
+        const int8_t w = (j + c < columns) ? weight_at(k, j + c) : 0;
+        word |= static_cast<uint32_t>(static_cast<uint8_t>(w)) << (8 * c);
+      }
+      CFU_OP(6, 1, word, 0);  // write and advance
+    }
+  }
+
+  layer.base = static_cast<int32_t>(base);
+  table.next_free = base + bytes;
+  return static_cast<int32_t>(base);
+}
+
+// Weights are normally registered at Prepare time; kernels call this on
+// every Eval instead so the first inference loads them, by calling
+// register_weights(), and later ones only send activations. Returns the base
+// address, -1 for a spilled layer, which is not retried.
+template <typename RegisterWeights>
+inline int32_t CfuEnsureWeights(const void* key,
+                                RegisterWeights register_weights) {
+  const CfuResidentWeights* layer = CfuFindWeights(key);
+  return layer ? layer->base : register_weights();
+}
+
+// Forgets all registrations, e.g. before loading another model.
+inline void CfuResetWeights() {
+  CfuWeightTable& table = GetCfuWeightTable();
+  table.num_layers = 0;
+  table.next_free = kCfuWeightScratchBytes;
+  table.spilled_bytes = 0;
+}
+
+#endif  // CFU_WEIGHT_STORE_H_
@@ -0,0 +1,180 @@
+#ifndef CONV_AUTOTUNE_H_
+#define CONV_AUTOTUNE_H_
+
+#include <cstdint>
+#include <cstdio>
+
+#include "perf.h"
+
+/* Per layer backend selection for ConvPerChannel.
+
+   Build with CONV_AUTOTUNE defined and run the model once: the first time a
+   conv shape shows up every backend is timed with perf_get_mcycle() and the
+   fastest one is kept. PrintConvBackendTable() then prints the table as a
+   header, save it over conv_backend_table.h and rebuild without
+   CONV_AUTOTUNE. Production builds only look the shape up, shapes missing
+   from the table run on the CFU. Past kMaxTunedConvShapes shapes nothing
+   more is timed, later shapes use LookupConvBackend() too.
+*/
+enum class ConvBackend : uint8_t {
+  kCpuReference,  // direct nested loops
+  kCpuIm2col,     // im2col GEMM on the CPU
+  kCfu,           // im2col GEMM on the CFU
+};
+constexpr int kNumConvBackends = 3;
+
+inline const char* ConvBackendName(ConvBackend backend) {
+  switch (backend) {
+    case ConvBackend::kCpuReference: return "kCpuReference";
+    case ConvBackend::kCpuIm2col: return "kCpuIm2col";
+    default: return "kCfu";
+  }
+}
+
+// Everything that changes the cost of a conv layer, batch excluded.
+struct ConvShape {
+  uint16_t input_height, input_width, input_depth;
+  uint16_t output_height, output_width, output_depth;
+  uint16_t filter_height, filter_width;
+  uint16_t stride_height, stride_width;
+  uint16_t dilation_height, dilation_width;
+  uint16_t pad_height, pad_width;
+
+  bool operator==(const ConvShape& other) const {
+    return input_height == other.input_height &&
+           input_width == other.input_width &&
+           input_depth == other.input_depth &&
+           output_height == other.output_height &&
+           output_width == other.output_width &&
+           output_depth == other.output_depth &&
+           filter_height == other.filter_height &&
+           filter_width == other.filter_width &&
+           stride_height == other.stride_height &&
+           stride_width == other.stride_width &&
+           dilation_height == other.dilation_height &&
+           dilation_width == other.dilation_width &&
+           pad_height == other.pad_height && pad_width == other.pad_width;
+  }
+};
+
+struct ConvBackendEntry {
+  ConvShape shape;
+  ConvBackend backend;
+};
+
+// Generated decision table, needs the types above.
+#include "conv_backend_table.h"
+
+inline ConvBackend LookupConvBackend(const ConvShape& shape) {
+  for (const ConvBackendEntry& entry : kConvBackendTable) {
+    if (entry.shape == shape) {
+      return entry.backend;
+    }
+  }
+  return ConvBackend::kCfu;
+}
+
+#ifdef CONV_AUTOTUNE
+constexpr int kMaxTunedConvShapes = 32;
+
+struct TunedConvTable {
+  ConvBackendEntry entries[kMaxTunedConvShapes];
+  uint32_t cycles[kMaxTunedConvShapes][kNumConvBackends];
+  int num_entries = 0;
+  bool warned_full = false;
+};
+
+inline TunedConvTable& GetTunedConvTable() {
+  static TunedConvTable table;
+  return table;
+}
+
+// Returns false if the shape still has to be tuned. Once the table is full
+// every new shape falls back to LookupConvBackend() instead of being timed
+// again on each call.
+inline bool FindTunedConvBackend(const ConvShape& shape,
+                                 ConvBackend* backend) {
+  TunedConvTable& table = GetTunedConvTable();
+  for (int i = 0; i < table.num_entries; ++i) {
+    if (table.entries[i].shape == shape) {
+      *backend = table.entries[i].backend;
+      return true;
+    }
+  }
+  if (table.num_entries == kMaxTunedConvShapes) {
+    if (!table.warned_full) {
+      printf("conv autotune: more than %d conv shapes, raise "
+             "kMaxTunedConvShapes, the rest use the built-in table\n",
+             kMaxTunedConvShapes);
+      table.warned_full = true;
+    }
+    *backend = LookupConvBackend(shape);
+    return true;
+  }
+  return false;
+}
+
+// Times run(backend) for every backend and records the fastest. run() has to
+// produce the same output for all of them, the last run's output is kept.
+// Each backend gets the best of two passes, so the one that happens to run
+// first does not pay for the cold caches.
+template <typename RunBackend>
+inline ConvBackend TuneConvBackend(const ConvShape& shape, RunBackend run) {
+  TunedConvTable& table = GetTunedConvTable();
+  uint32_t cycles[kNumConvBackends];
+  for (int pass = 0; pass < 2; ++pass) {
+    for (int b = 0; b < kNumConvBackends; ++b) {
+      unsigned start = perf_get_mcycle();
+      run(static_cast<ConvBackend>(b));
+      unsigned finish = perf_get_mcycle();
+      const uint32_t elapsed = finish - start;
+      if (pass == 0 || elapsed < cycles[b]) {
+        cycles[b] = elapsed;
+      }
+    }
+  }
+  int best = 0;
+  for (int b = 1; b < kNumConvBackends; ++b) {
+    if (cycles[b] < cycles[best]) {
+      best = b;
+    }
+  }
+
+  const int i = table.num_entries++;  // FindTunedConvBackend checked the room
+  table.entries[i].shape = shape;
+  table.entries[i].backend = static_cast<ConvBackend>(best);
+  for (int b = 0; b < kNumConvBackends; ++b) {
+    table.cycles[i][b] = cycles[b];
+  }
+  return static_cast<ConvBackend>(best);
+}
+
+// Prints the tuned table in the format of conv_backend_table.h.
+inline void PrintConvBackendTable() {
+  const TunedConvTable& table = GetTunedConvTable();
+  printf("// Generated by PrintConvBackendTable() in a CONV_AUTOTUNE build.\n");
+  printf("#ifndef CONV_BACKEND_TABLE_H_\n#define CONV_BACKEND_TABLE_H_\n\n");
+  printf("// {input h, w, c, output h, w, c, filter h, w, stride h, w, "
+         "dilation h, w, pad h, w}, backend\n");
+  printf("constexpr ConvBackendEntry kConvBackendTable[] = {\n");
+  for (int i = 0; i < table.num_entries; ++i) {
+    const ConvShape& s = table.entries[i].shape;
+    printf("    {{%d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d}, "
+           "ConvBackend::%s},  // cycles %lu / %lu / %lu\n",
+           s.input_height, s.input_width, s.input_depth, s.output_height,
+           s.output_width, s.output_depth,
+           s.filter_height, s.filter_width, s.stride_height, s.stride_width,
+           s.dilation_height, s.dilation_width, s.pad_height, s.pad_width,
+           ConvBackendName(table.entries[i].backend),
+           static_cast<unsigned long>(table.cycles[i][0]),
+           static_cast<unsigned long>(table.cycles[i][1]),
+           static_cast<unsigned long>(table.cycles[i][2]));
+  }
+  printf("    // Sentinel, never matches a real layer.\n");
+  printf("    {{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, "
+         "ConvBackend::kCfu},\n");
+  printf("};\n\n#endif  // CONV_BACKEND_TABLE_H_\n");
+}
+#endif  // CONV_AUTOTUNE
+
+#endif  // CONV_AUTOTUNE_H_
@@ -0,0 +1,11 @@
+// Generated by PrintConvBackendTable() in a CONV_AUTOTUNE build.
+#ifndef CONV_BACKEND_TABLE_H_
+#define CONV_BACKEND_TABLE_H_
+
+// {input h, w, c, output h, w, c, filter h, w, stride h, w, dilation h, w, pad h, w}, backend
+constexpr ConvBackendEntry kConvBackendTable[] = {
+    // Sentinel, never matches a real layer.
+    {{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, ConvBackend::kCfu},
+};
+
+#endif  // CONV_BACKEND_TABLE_H_